@@ -0,0 +1,137 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "shape.cpp"
+
+using namespace glm;
+
+// Per-pixel running sums of radiance samples. Keeping sums and sample counts
+// (instead of a running average) lets individual pixels be carried over,
+// reset or sampled independently of each other.
+class Accumulator {
+  private:
+    static constexpr char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'K',
+                                                 'P', 'T', '0', '1'};
+
+  public:
+    int width;
+    int height;
+
+    std::vector<dvec3> sum;
+    std::vector<int> samples;
+
+    // First surface hit through each pixel center, used to decide which
+    // samples are still valid after the camera moves. Only allocated when
+    // requested, plain progressive renders don't need them.
+    std::vector<const Shape *> first_shape;
+    std::vector<int> first_primitive;
+    std::vector<dvec3> first_point;
+
+    Accumulator(int width, int height, bool first_hits = false)
+        : width(width), height(height), sum(width * height),
+          samples(width * height) {
+        if (first_hits) {
+            first_shape.assign(width * height, nullptr);
+            first_primitive.assign(width * height, -1);
+            first_point.resize(width * height);
+        }
+    }
+
+    void add(int i, const dvec3 &color) {
+        sum[i] += color;
+        samples[i]++;
+    }
+
+    dvec3 mean(int i) const {
+        if (samples[i] == 0)
+            return {0, 0, 0};
+        return sum[i] / (double)samples[i];
+    }
+
+    // Checkpoint layout: magic, width, height, scene hash, completed
+    // iterations, then the raw per-pixel sums and sample counts. Written to a
+    // temporary file first so a kill mid-write keeps the previous checkpoint.
+    bool save(const std::string &filename, uint64_t scene_hash,
+              int iterations) const {
+        std::string tmp = filename + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out)
+                return false;
+
+            out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+            out.write(reinterpret_cast<const char *>(&width), sizeof(width));
+            out.write(reinterpret_cast<const char *>(&height), sizeof(height));
+            out.write(reinterpret_cast<const char *>(&scene_hash),
+                      sizeof(scene_hash));
+            out.write(reinterpret_cast<const char *>(&iterations),
+                      sizeof(iterations));
+            out.write(reinterpret_cast<const char *>(sum.data()),
+                      sum.size() * sizeof(dvec3));
+            out.write(reinterpret_cast<const char *>(samples.data()),
+                      samples.size() * sizeof(int));
+
+            if (!out)
+                return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tmp, filename, error);
+        return !error;
+    }
+
+    // Restores sums and sample counts from a checkpoint made with the same
+    // resolution and scene hash
+    bool load(const std::string &filename, uint64_t scene_hash,
+              int &iterations) {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+            return false;
+
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        int file_width, file_height;
+        uint64_t file_hash;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char *>(&file_width), sizeof(file_width));
+        in.read(reinterpret_cast<char *>(&file_height), sizeof(file_height));
+        in.read(reinterpret_cast<char *>(&file_hash), sizeof(file_hash));
+
+        if (!in || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+            file_width != width || file_height != height ||
+            file_hash != scene_hash)
+            return false;
+
+        int file_iterations;
+        std::vector<dvec3> file_sum(width * height);
+        std::vector<int> file_samples(width * height);
+        in.read(reinterpret_cast<char *>(&file_iterations),
+                sizeof(file_iterations));
+        in.read(reinterpret_cast<char *>(file_sum.data()),
+                file_sum.size() * sizeof(dvec3));
+        in.read(reinterpret_cast<char *>(file_samples.data()),
+                file_samples.size() * sizeof(int));
+        if (!in)
+            return false;
+
+        iterations = file_iterations;
+        sum = std::move(file_sum);
+        samples = std::move(file_samples);
+        return true;
+    }
+
+    std::vector<dvec3> resolve() const {
+        std::vector<dvec3> colors(width * height);
+        for (int i = 0; i < width * height; i++) {
+            colors[i] = mean(i);
+        }
+        return colors;
+    }
+};
+
+#endif
@@ -1,5 +1,12 @@
 #include "common.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "accumulator.cpp"
 #include "ppm.hpp"
 #include "ray.cpp"
 #include "shape.cpp"
@@ -13,12 +20,56 @@ class Camera {
     dvec3 direction;
     double FOV;
 
+    // Image size in pixels
+    int width;
+    int height;
+
+    double viewport_width;
+    double viewport_height;
+
     dvec3 viewport_u;
     dvec3 viewport_v;
 
     dvec3 dx;
     dvec3 dy;
 
+    // Max distance between the old and new first hit, relative to the
+    // distance from the camera, for a reprojected pixel to keep its samples
+    static constexpr double REPROJECTION_TOLERANCE = 1e-2;
+
+    // Sky gradient seen by rays that leave the scene
+    static inline const dvec3 SKY_HORIZON{1.0, 1.0, 1.0};
+    static inline const dvec3 SKY_ZENITH{0.1, 0.4, 1.0};
+    static constexpr double SKY_INTENSITY = 0.4;
+
+    // Bounces always taken before Russian roulette may end a path, negative
+    // disables it (every path runs to the full bounce count)
+    int rr_min_depth = 3;
+
+    // Number of paths per length (rays traced), since the last render
+    std::vector<size_t> path_lengths;
+
+    // Raw accumulation is saved to checkpoint_path every checkpoint_every
+    // iterations (0 disables), and render() resumes from it if resume is set.
+    // A resumed render always saves after its last iteration, so it never
+    // loses the progress it resumed from.
+    std::string checkpoint_path = "out.ckpt";
+    int checkpoint_every = 0;
+    bool resume = false;
+
+    void update_viewport() {
+        dmat4 cam_matrix = get_cam_matrix();
+
+        viewport_u =
+            cam_matrix * dvec4(viewport_width, 0, 0, 1.0) - dvec4(position, 0);
+
+        viewport_v = cam_matrix * dvec4(0, -viewport_height, 0, 1.0) -
+                     dvec4(position, 0);
+
+        dx = viewport_u * (1.0 / width);
+        dy = viewport_v * (1.0 / height);
+    }
+
   public:
     // Camera() {
     //     this->position = {0, 0, 0};
@@ -26,21 +77,18 @@ class Camera {
     //     this->FOV = 90;
     // }
 
-    Camera(dvec3 position, dvec3 direction, double FOV) {
+    Camera(dvec3 position, dvec3 direction, double FOV, int width = WIDTH,
+           int height = HEIGHT) {
         this->position = position;
         this->direction = normalize(direction);
         this->FOV = FOV;
+        this->width = width;
+        this->height = height;
 
-        dmat4 cam_matrix = get_cam_matrix();
-
-        viewport_u =
-            cam_matrix * dvec4(VIEWPORT_WIDTH, 0, 0, 1.0) - dvec4(position, 0);
-
-        viewport_v = cam_matrix * dvec4(0, -VIEWPORT_HEIGHT, 0, 1.0) -
-                     dvec4(position, 0);
+        viewport_height = VIEWPORT_HEIGHT;
+        viewport_width = viewport_height * width / height;
 
-        dx = viewport_u * (1.0 / WIDTH);
-        dy = viewport_v * (1.0 / HEIGHT);
+        update_viewport();
     }
 
     const dvec3 &get_position() const { return position; }
@@ -49,6 +97,71 @@ class Camera {
 
     const double &get_fov() const { return FOV; }
 
+    void set_position(const dvec3 &position) {
+        this->position = position;
+        update_viewport();
+    }
+
+    void set_direction(const dvec3 &direction) {
+        this->direction = normalize(direction);
+        update_viewport();
+    }
+
+    void set_fov(double FOV) {
+        this->FOV = FOV;
+        update_viewport();
+    }
+
+    void set_russian_roulette(int min_depth) { rr_min_depth = min_depth; }
+
+    void set_checkpoint(const std::string &path, int every, bool resume) {
+        checkpoint_path = path;
+        checkpoint_every = every;
+        this->resume = resume;
+    }
+
+    // Fingerprint of everything a checkpoint depends on: resolution, camera,
+    // bounce settings, sky and every primitive of the scene
+    uint64_t scene_hash(const Hittable &world, int bounces) const {
+        uint64_t hash = HASH_SEED;
+
+        hash_value(hash, width);
+        hash_value(hash, height);
+        hash_value(hash, position);
+        hash_value(hash, direction);
+        hash_value(hash, FOV);
+        hash_value(hash, bounces);
+        hash_value(hash, rr_min_depth);
+        hash_value(hash, SKY_HORIZON);
+        hash_value(hash, SKY_ZENITH);
+        hash_value(hash, SKY_INTENSITY);
+
+        world.hash(hash);
+        return hash;
+    }
+
+    const std::vector<size_t> &get_path_lengths() const { return path_lengths; }
+
+    void print_path_lengths() const {
+        size_t paths = 0;
+        size_t rays = 0;
+        for (int i = 0; i < path_lengths.size(); i++) {
+            paths += path_lengths[i];
+            rays += path_lengths[i] * i;
+        }
+        if (paths == 0)
+            return;
+
+        std::printf("Path lengths:\n");
+        for (int i = 0; i < path_lengths.size(); i++) {
+            if (path_lengths[i] == 0)
+                continue;
+            std::printf("%4d: %zu (%.2f%%)\n", i, path_lengths[i],
+                        100.0 * path_lengths[i] / paths);
+        }
+        std::printf("Mean path length: %.3f\n", (double)rays / paths);
+    }
+
     double get_focal_length(double viewport_height) const {
         return (viewport_height / 2.0) / glm::tan(glm::radians(FOV / 2.0));
     }
@@ -83,40 +196,128 @@ class Camera {
         dmat4 cam_matrix = get_cam_matrix();
 
         dvec3 viewport_u =
-            cam_matrix * dvec4(VIEWPORT_WIDTH, 0, 0, 1.0) - dvec4(position, 0);
+            cam_matrix * dvec4(viewport_width, 0, 0, 1.0) - dvec4(position, 0);
 
-        dvec3 viewport_v = cam_matrix * dvec4(0, -VIEWPORT_HEIGHT, 0, 1.0) -
+        dvec3 viewport_v = cam_matrix * dvec4(0, -viewport_height, 0, 1.0) -
                            dvec4(position, 0);
 
-        dvec3 dx = viewport_u * (1.0 / WIDTH);
-        dvec3 dy = viewport_v * (1.0 / HEIGHT);
+        dvec3 dx = viewport_u * (1.0 / width);
+        dvec3 dy = viewport_v * (1.0 / height);
+
+        dvec3 lt = get_left_top(viewport_width, viewport_height);
 
-        dvec3 lt = get_left_top(VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+        path_lengths.assign(bounces + 2, 0);
 
-        std::vector<dvec3> colors(WIDTH * HEIGHT);
+        Accumulator acc(width, height);
+        uint64_t hash = scene_hash(world, bounces);
         int count = 1;
+
+        if (resume) {
+            int completed;
+            if (acc.load(checkpoint_path, hash, completed)) {
+                std::printf("Resuming after %d iterations\n", completed);
+                count = completed + 1;
+            } else {
+                std::cerr << "Cannot resume from " << checkpoint_path
+                          << ", starting over\n";
+            }
+        }
+
+        bool save_at_end = checkpoint_every > 0 || resume;
+        if (resume && checkpoint_every <= 0)
+            std::cerr << "No checkpoint interval set, saving "
+                      << checkpoint_path << " after the last iteration only\n";
+
+        int first = count;
+        // Only time spent tracing counts towards samples/sec, writing the
+        // image and checkpoints every iteration would skew it
+        double seconds = 0;
+
         while (count <= iterations) {
-            for (int y = 0; y < HEIGHT; y++) {
-                for (int x = 0; x < WIDTH; x++) {
-                    // shoot ray through pixel center
-                    Ray ray = get_ray(x, y);
+            auto start = std::chrono::steady_clock::now();
 
-                    unsigned int seed = y * WIDTH + x + count * 9483984;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    int i = y * width + x;
 
-                    colors[y * WIDTH + x] =
-                        colors[y * WIDTH + x] * (count - 1.0) +
-                        trace_ray(world, ray, bounces, seed);
-                    colors[y * WIDTH + x] /= (double)count;
+                    // Every sample only depends on its pixel and iteration,
+                    // so a resumed render continues the exact same sequence
+                    unsigned int seed = sample_seed(i, count);
+
+                    Ray ray = get_ray(x, y, seed);
+
+                    acc.add(i, trace_ray(world, ray, bounces, seed));
                 }
             }
 
-            write_ppm("out.ppm", WIDTH, HEIGHT, colors);
+            seconds += std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+
+            write_ppm("out.ppm", width, height, acc.resolve());
+
+            if ((checkpoint_every > 0 && count % checkpoint_every == 0) ||
+                (save_at_end && count == iterations)) {
+                if (!acc.save(checkpoint_path, hash, count))
+                    std::cerr << "Failed to write checkpoint "
+                              << checkpoint_path << "\n";
+            }
             count++;
         }
+
+        if (count == first) {
+            // Resumed from a checkpoint that already has every iteration
+            std::printf("Nothing to render, %d iterations already done\n",
+                        count - 1);
+            write_ppm("out.ppm", width, height, acc.resolve());
+            return;
+        }
+
+        std::printf("%.0f samples/sec\n",
+                    (double)width * height * (count - first) / seconds);
+        print_path_lengths();
+    }
+
+    // Progressive render into a caller-owned buffer of width * height RGB
+    // floats, row-major, which always holds the mean of the samples so far.
+    // `progress(iteration, iterations)` runs after every iteration. Returns
+    // false if `cancel` was set before the render finished.
+    template <typename Progress>
+    bool render_into(const Hittable &world, int bounces, int iterations,
+                     float *frame, Progress progress,
+                     const std::atomic<bool> *cancel) {
+        path_lengths.assign(bounces + 2, 0);
+        std::fill(frame, frame + width * height * 3, 0.0f);
+
+        for (int count = 1; count <= iterations; count++) {
+            for (int y = 0; y < height; y++) {
+                if (cancel && cancel->load(std::memory_order_relaxed))
+                    return false;
+
+                for (int x = 0; x < width; x++) {
+                    int i = y * width + x;
+
+                    unsigned int seed = sample_seed(i, count);
+
+                    Ray ray = get_ray(x, y, seed);
+
+                    dvec3 color = trace_ray(world, ray, bounces, seed);
+                    float *pixel = frame + i * 3;
+                    for (int c = 0; c < 3; c++) {
+                        pixel[c] += (float)((color[c] - pixel[c]) / count);
+                    }
+                }
+            }
+
+            progress(count, iterations);
+        }
+        return true;
     }
 
-    Ray get_ray(int x, int y) {
-        dvec3 lt = get_left_top(VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    Ray get_ray(int x, int y, unsigned int seed) {
+        // Jitter from its own stream, separate from the bounce directions
+        seed_random(~seed);
+        dvec3 lt = get_left_top(viewport_width, viewport_height);
         double offset_x = random_double(-.5, .5);
         double offset_y = random_double(-.5, .5);
         dvec3 pos =
@@ -125,12 +326,215 @@ class Camera {
         return {get_position(), pos - get_position()};
     }
 
+    // Ray through the exact pixel center, without jitter
+    Ray get_center_ray(int x, int y) const {
+        dvec3 lt = get_left_top(viewport_width, viewport_height);
+        dvec3 pos = lt + (x + 0.5) * dx + (y + 0.5) * dy;
+
+        return {get_position(), pos - get_position()};
+    }
+
+    // World to camera space, the inverse of get_cam_matrix()
+    dmat4 get_view_matrix() const { return inverse(get_cam_matrix()); }
+
+    // Projects a world space point onto the image plane, in pixel units,
+    // given this camera's view matrix. Returns false if the point is behind
+    // the camera.
+    bool project(const dmat4 &view, const dvec3 &point, double &px,
+                 double &py) const {
+        dvec3 p = view * dvec4(point, 1.0);
+        if (p.z >= 0)
+            return false;
+
+        double fz = get_focal_length(viewport_height);
+        double s = -fz / p.z;
+
+        px = (p.x * s + viewport_width / 2.0) / viewport_width * width - 0.5;
+        py = (viewport_height / 2.0 - p.y * s) / viewport_height * height - 0.5;
+        return true;
+    }
+
+    void find_first_hits(const Hittable &world, Accumulator &acc) const {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                HitInfo hit;
+                world.get_intersection(get_center_ray(x, y), hit);
+
+                int i = y * width + x;
+                acc.first_shape[i] = hit.did_hit ? hit.shape : nullptr;
+                acc.first_primitive[i] = hit.did_hit ? hit.primitive : -1;
+                acc.first_point[i] = hit.point;
+            }
+        }
+    }
+
+    // Carries the samples of `acc`, taken from `previous`, over to this
+    // camera. A pixel keeps the samples of the old pixel its first hit
+    // projects to, as long as that pixel saw the same surface at the same
+    // spot. Sky only depends on the ray direction, so sky pixels keep the
+    // samples of the old sky pixel looking the same way. Disoccluded pixels
+    // start over from zero samples. Returns the number of pixels that kept
+    // their samples.
+    int reproject(const Hittable &world, const Camera &previous,
+                  Accumulator &acc) const {
+        Accumulator next(width, height, true);
+        find_first_hits(world, next);
+
+        dmat4 previous_view = previous.get_view_matrix();
+
+        int kept = 0;
+        for (int i = 0; i < width * height; i++) {
+            bool sky = next.first_shape[i] == nullptr;
+
+            // For the sky, project a point along the ray direction as seen
+            // from the previous position
+            dvec3 target = next.first_point[i];
+            if (sky) {
+                Ray ray = get_center_ray(i % width, i / width);
+                target = previous.get_position() + ray.get_direction();
+            }
+
+            double px, py;
+            if (!previous.project(previous_view, target, px, py))
+                continue;
+
+            int ox = (int)std::lround(px);
+            int oy = (int)std::lround(py);
+            if (ox < 0 || ox >= width || oy < 0 || oy >= height)
+                continue;
+
+            int j = oy * width + ox;
+            // Same surface means the same shape and, within a mesh, the same
+            // triangle
+            if (acc.first_shape[j] != next.first_shape[i] ||
+                acc.first_primitive[j] != next.first_primitive[i])
+                continue;
+
+            if (sky) {
+                next.sum[i] = acc.sum[j];
+                next.samples[i] = acc.samples[j];
+                kept++;
+                continue;
+            }
+
+            double depth = length(next.first_point[i] - position);
+            double error = length(acc.first_point[j] - next.first_point[i]);
+            if (error > REPROJECTION_TOLERANCE * depth)
+                continue;
+
+            next.sum[i] = acc.sum[j];
+            next.samples[i] = acc.samples[j];
+            kept++;
+        }
+
+        acc = std::move(next);
+        return kept;
+    }
+
+    // One progressive pass. While some pixels have fewer samples than others
+    // (e.g. after a reprojection), only those are sampled so they catch up.
+    void sample_pass(const Hittable &world, int bounces, Accumulator &acc,
+                     unsigned int pass) {
+        auto [min_samples, max_samples] =
+            std::minmax_element(acc.samples.begin(), acc.samples.end());
+        bool catching_up = *min_samples != *max_samples;
+        int target = *max_samples;
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int i = y * width + x;
+                if (catching_up && acc.samples[i] >= target)
+                    continue;
+
+                unsigned int seed = sample_seed(i, pass);
+
+                Ray ray = get_ray(x, y, seed);
+
+                acc.add(i, trace_ray(world, ray, bounces, seed));
+            }
+        }
+    }
+
+    // Interactive session driven by line commands on `in`:
+    //   pos <x> <y> <z>   move the camera
+    //   dir <x> <y> <z>   point the camera
+    //   fov <degrees>     change the field of view
+    //   frames <n>        render n passes, writing a binary PPM after each
+    //   quit
+    // Moving the camera keeps every accumulated sample that is still valid.
+    // Frames go to `out`; log messages go to stderr.
+    void interactive(const Hittable &world, int bounces, std::istream &in,
+                     std::ostream &out) {
+        Accumulator acc(width, height, true);
+        find_first_hits(world, acc);
+        path_lengths.assign(bounces + 2, 0);
+
+        unsigned int pass = 0;
+        std::string line;
+        while (std::getline(in, line)) {
+            std::stringstream ss(line);
+            std::string command;
+            ss >> command;
+
+            if (command == "pos" || command == "dir" || command == "fov") {
+                Camera previous = *this;
+
+                if (command == "fov") {
+                    double fov;
+                    if (!(ss >> fov) || fov <= 0 || fov >= 180) {
+                        std::cerr << "Invalid fov: " << line << "\n";
+                        continue;
+                    }
+                    set_fov(fov);
+                } else {
+                    dvec3 v;
+                    if (!(ss >> v.x >> v.y >> v.z)) {
+                        std::cerr << "Invalid " << command << ": " << line
+                                  << "\n";
+                        continue;
+                    }
+
+                    if (command == "pos") {
+                        set_position(v);
+                    } else {
+                        // The camera basis needs a direction that is neither
+                        // zero nor parallel to the world up vector
+                        if (dot(cross(dvec3(0, 1, 0), v),
+                                cross(dvec3(0, 1, 0), v)) == 0) {
+                            std::cerr << "Invalid dir: " << line << "\n";
+                            continue;
+                        }
+                        set_direction(v);
+                    }
+                }
+
+                int kept = reproject(world, previous, acc);
+                std::cerr << "Reprojected " << kept << " / " << width * height
+                          << " pixels\n";
+            } else if (command == "frames") {
+                int frames;
+                if (!(ss >> frames))
+                    frames = 1;
+                for (int f = 0; f < frames; f++) {
+                    sample_pass(world, bounces, acc, ++pass);
+                    write_ppm_binary(out, width, height, acc.resolve());
+                }
+            } else if (command == "quit") {
+                break;
+            } else if (!command.empty()) {
+                std::cerr << "Unknown command: " << command << "\n";
+            }
+        }
+    }
+
     dvec3 trace_ray(const Hittable &world, Ray ray, int bounces,
                     unsigned int &seed) {
         dvec3 color{1, 1, 1};
         dvec3 light{0, 0, 0};
 
+        int length = 0;
         for (int i = 0; i <= bounces; i++) {
+            length++;
             HitInfo hit;
 
             world.get_intersection(ray, hit);
@@ -153,17 +557,34 @@ class Camera {
                 //     direction = -direction;
 
                 ray = Ray(hit.point + hit.normal * 1e-8, direction);
+
+                // Russian roulette: past the minimum depth, continue with a
+                // probability equal to the throughput and reweight surviving
+                // paths so the estimate stays unbiased
+                if (rr_min_depth >= 0 && i >= rr_min_depth) {
+                    double p = std::min(1.0, std::max({color.r, color.g,
+                                                       color.b}));
+                    if (random_double() >= p)
+                        break;
+                    color /= p;
+                }
+
+                seed = bounce_seed(seed, i + 1);
             } else {
                 dvec3 unit_direction = normalize(ray.get_direction());
                 double a = 0.5 * (unit_direction.y + 1.0);
-                dvec3 environment_light = ((1.0 - a) * dvec3(1.0, 1.0, 1.0) +
-                                           a * dvec3(0.1, 0.4, 1.0));
-                double sky_intensity = 0.4;
+                dvec3 environment_light =
+                    ((1.0 - a) * SKY_HORIZON + a * SKY_ZENITH);
                 // dvec3 environment_light{0, 0, 0};
-                light += color * environment_light * sky_intensity;
+                light += color * environment_light * SKY_INTENSITY;
                 break;
             }
         }
+
+        if (path_lengths.size() <= length)
+            path_lengths.resize(length + 1);
+        path_lengths[length]++;
+
         return light;
     }
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+# raytracer.cpp includes the renderer sources inside namespace
+# raytracer::detail. A system or glm header that is first included from there
+# would be declared inside that namespace, so every such header must already
+# be included by raytracer.cpp before it opens the namespace.
+#
+# Usage: cmake -DSOURCE_DIR=<dir> -DSTAMP=<file> -P check_detail_includes.cmake
+
+cmake_minimum_required(VERSION 3.10)
+
+file(STRINGS ${SOURCE_DIR}/raytracer.cpp lines REGEX "^#include ")
+
+set(pre_included)
+set(pending)
+foreach(line ${lines})
+    if(line MATCHES "^#include <([^>]+)>")
+        list(APPEND pre_included ${CMAKE_MATCH_1})
+    elseif(line MATCHES "^#include \"([^\"]+)\"" AND
+           NOT CMAKE_MATCH_1 STREQUAL "raytracer.hpp")
+        list(APPEND pending ${CMAKE_MATCH_1})
+    endif()
+endforeach()
+
+# Follow the quoted includes from the wrapped sources
+set(visited)
+set(missing)
+while(pending)
+    list(GET pending 0 source)
+    list(REMOVE_AT pending 0)
+    list(FIND visited ${source} seen)
+    if(NOT seen EQUAL -1)
+        continue()
+    endif()
+    list(APPEND visited ${source})
+
+    file(STRINGS ${SOURCE_DIR}/${source} lines REGEX "^#include ")
+    foreach(line ${lines})
+        if(line MATCHES "^#include <([^>]+)>")
+            list(FIND pre_included ${CMAKE_MATCH_1} found)
+            if(found EQUAL -1)
+                list(APPEND missing "${source}: <${CMAKE_MATCH_1}>")
+            endif()
+        elseif(line MATCHES "^#include \"([^\"]+)\"")
+            list(APPEND pending ${CMAKE_MATCH_1})
+        endif()
+    endforeach()
+endwhile()
+
+if(missing)
+    string(REPLACE ";" "\n  " missing "${missing}")
+    message(FATAL_ERROR
+        "Headers used by the renderer sources but not included by "
+        "raytracer.cpp before namespace raytracer::detail:\n  ${missing}")
+endif()
+
+file(WRITE ${STAMP} "")
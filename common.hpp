@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <concepts>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -27,7 +28,76 @@ const double ASPECT_RATIO = ((double)WIDTH) / ((double)HEIGHT);
 const double VIEWPORT_HEIGHT = 2.0;
 const double VIEWPORT_WIDTH = ASPECT_RATIO * VIEWPORT_HEIGHT;
 
-inline double random_double() { return std::rand() / (RAND_MAX - 1.0); }
+// PCG RXS-M-XS permutation of one LCG step, used as a 32-bit hash
+inline unsigned int pcg_hash(unsigned int x) {
+    unsigned int state = x * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Seed of the next bounce of a path. Hashed rather than stepped, so it never
+// lands on a later position of the current bounce's random stream.
+inline unsigned int bounce_seed(unsigned int seed, int bounce) {
+    return pcg_hash(seed ^ pcg_hash(bounce));
+}
+
+// Seed of one sample, from a 64-bit hash (SplitMix64) of its pixel and
+// iteration, so no two samples of a render share their random sequence
+inline unsigned int sample_seed(int pixel, int iteration) {
+    uint64_t z = ((uint64_t)(unsigned int)iteration << 32) |
+                 (uint64_t)(unsigned int)pixel;
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (unsigned int)(z ^ (z >> 32));
+}
+
+// FNV-1a, used to fingerprint scenes for checkpoints
+const uint64_t HASH_SEED = 14695981039346656037ull;
+
+inline void hash_bytes(uint64_t &hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+template <typename T> void hash_value(uint64_t &hash, const T &value) {
+    hash_bytes(hash, &value, sizeof(value));
+}
+
+// Random state is per thread so concurrent renders don't share a sequence.
+// Each seed selects its own PCG stream (the LCG increment) as well as a
+// starting state, so differently seeded sequences are not shifted copies of
+// each other.
+struct RandomState {
+    unsigned int state = 1;
+    unsigned int increment = 1;
+};
+
+inline RandomState &random_state() {
+    thread_local RandomState state;
+    return state;
+}
+
+inline void seed_random(unsigned int seed) {
+    RandomState &random = random_state();
+    random.increment = (pcg_hash(seed) << 1u) | 1u;
+    random.state = pcg_hash(seed ^ 0x9e3779b9u);
+}
+
+inline double random_double() {
+    RandomState &random = random_state();
+    random.state = random.state * 747796405u + random.increment;
+
+    // PCG RXS-M-XS output permutation
+    unsigned int state = random.state;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    word = (word >> 22u) ^ word;
+    return word / 4294967296.0;
+}
 
 inline double random_double(double min, double max) {
     return min + (max - min) * random_double();
@@ -35,7 +105,7 @@ inline double random_double(double min, double max) {
 
 inline dvec3 random_unit_vector(unsigned int seed) {
     dvec3 candidate;
-    std::srand(seed);
+    seed_random(seed);
     while (true) {
         candidate = {random_double(-1, 1), random_double(-1, 1),
                      random_double(-1, 1)};
@@ -13,6 +13,12 @@ class HitInfo {
     dvec3 normal;
     double t;
 
+    // Filled in by the closest-hit query; point and normal are only
+    // computed afterwards, for the winning hit
+    int primitive = -1;
+    double u = 0;
+    double v = 0;
+
     HitInfo() {}
     HitInfo(double t) : t(t) {}
 };
@@ -1,5 +1,8 @@
 #include "common.hpp"
 
+#include <cstdlib>
+#include <cstring>
+
 #include "camera.cpp"
 #include "obj.cpp"
 #include "ppm.hpp"
@@ -8,7 +11,30 @@
 
 using namespace glm;
 
-int main(int, char **) {
+int main(int argc, char **argv) {
+
+    bool interactive = false;
+    bool fixed_depth = false;
+    bool resume = false;
+    int iterations = 1000;
+    int checkpoint_every = 0;
+    // Out-of-core geometry budget in MiB, negative keeps everything resident
+    double budget_mib = -1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--interactive") == 0)
+            interactive = true;
+        else if (std::strcmp(argv[i], "--fixed-depth") == 0)
+            fixed_depth = true;
+        else if (std::strcmp(argv[i], "--out-of-core") == 0 && i + 1 < argc)
+            budget_mib = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--checkpoint-every") == 0 &&
+                 i + 1 < argc)
+            checkpoint_every = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--resume") == 0)
+            resume = true;
+    }
 
     HitList world;
 
@@ -30,24 +56,49 @@ int main(int, char **) {
 
     // // Sun
     Material m5{dvec3{0, 0, 0}, dvec3{1, 1, 1}, 2, 0};
-    Sphere sphere5{dvec3{0, 0, 0}, m5, 1};
+    Sphere *sphere5 = new Sphere{dvec3{0, 0, 0}, m5, 1};
 
     // world.add(&sphere1);
     // world.add(&sphere2);
     // world.add(&sphere3);
     // world.add(&sphere4);
-    world.add(&sphere5);
+    world.add(sphere5);
     // world.add(&triangle);
 
     // Monkey
     Material m_monkey{{.2, .4, .7}, {0, 0, 0}, 0, .1};
-    Mesh monkey = load_obj_triangles("assets/monkey.obj", m_monkey);
-    monkey.set_position({0, 0, -3});
-    // monkey.set_rotation({0, 1, 0}, quarter_pi<double>());
+    StreamedMesh *streamed_monkey = nullptr;
+    if (budget_mib >= 0) {
+        streamed_monkey = load_obj_streamed(
+            "assets/monkey.obj", m_monkey, {0, 0, -3}, "monkey.clusters",
+            (size_t)(budget_mib * 1024 * 1024));
+        world.add(streamed_monkey);
+    } else {
+        Mesh *monkey =
+            new Mesh(load_obj_triangles("assets/monkey.obj", m_monkey));
+        monkey->set_position({0, 0, -3});
+        // monkey->set_rotation({0, 1, 0}, quarter_pi<double>());
 
-    world.add(&monkey);
+        world.add(monkey);
+    }
 
     Camera camera{{-6, 0, 2}, {2, 0, -1}, 30};
 
-    camera.render(world, 10, 1000);
+    // Russian roulette keeps the cost of deep paths low, so allow many more
+    // bounces than the fixed-depth mode
+    int bounces = 50;
+    if (fixed_depth) {
+        camera.set_russian_roulette(-1);
+        bounces = 10;
+    }
+
+    camera.set_checkpoint("out.ckpt", checkpoint_every, resume);
+
+    if (interactive)
+        camera.interactive(world, bounces, std::cin, std::cout);
+    else
+        camera.render(world, bounces, iterations);
+
+    if (streamed_monkey)
+        streamed_monkey->print_stats();
 }
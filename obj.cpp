@@ -3,20 +3,26 @@
 
 #include "common.hpp"
 
+#include <cstdio>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "shape.cpp"
+#include "streamed_mesh.cpp"
 
+// Indices as written in the file: 1-based, negative ones count back from the
+// last vertex read so far, 0 if absent
 struct ObjIndex {
-    int v = -1;
-    int vn = -1;
+    int v = 0;
+    int vn = 0;
 };
 
+// Throws std::invalid_argument or std::out_of_range on malformed numbers
 static ObjIndex parse_face_token(const std::string &token) {
     ObjIndex idx;
     std::stringstream ss(token);
@@ -24,7 +30,7 @@ static ObjIndex parse_face_token(const std::string &token) {
 
     // v
     std::getline(ss, part, '/');
-    idx.v = std::stoi(part) - 1;
+    idx.v = std::stoi(part);
 
     // vt (ignored)
     if (ss.peek() == '/')
@@ -35,26 +41,41 @@ static ObjIndex parse_face_token(const std::string &token) {
     // vn
     if (std::getline(ss, part, '/')) {
         if (!part.empty())
-            idx.vn = std::stoi(part) - 1;
+            idx.vn = std::stoi(part);
     }
 
     return idx;
 }
 
-Mesh load_obj_triangles(const std::string &filename, const Material &material) {
-    Mesh mesh{material};
+// Turns an OBJ index into a 0-based one into a list of `count` elements.
+// Returns false if it doesn't name an element read so far.
+static bool resolve_obj_index(int index, size_t count, int &resolved) {
+    long long i = index > 0 ? (long long)index - 1 : (long long)count + index;
+    if (index == 0 || i < 0 || i >= (long long)count)
+        return false;
 
+    resolved = (int)i;
+    return true;
+}
+
+// Calls `emit(a, b, c, na, nb, nc)` for every triangle in the OBJ file.
+// Returns false if the file cannot be opened or a face is malformed or
+// references a missing vertex; triangles before it have been emitted.
+template <typename F>
+static bool read_obj_triangles(const std::string &filename, F emit) {
     std::vector<glm::dvec3> positions;
     std::vector<glm::dvec3> normals;
 
     std::ifstream file(filename);
     if (!file) {
         std::cerr << "Failed to open OBJ file: " << filename << "\n";
-        return mesh;
+        return false;
     }
 
     std::string line;
+    int line_number = 0;
     while (std::getline(file, line)) {
+        line_number++;
         std::stringstream ss(line);
         std::string type;
         ss >> type;
@@ -75,38 +96,93 @@ Mesh load_obj_triangles(const std::string &filename, const Material &material) {
 
         // Face
         else if (type == "f") {
-            std::vector<ObjIndex> face;
+            std::vector<glm::dvec3> face_positions;
+            std::vector<glm::dvec3> face_normals;
 
             std::string token;
             while (ss >> token) {
-                face.push_back(parse_face_token(token));
+                ObjIndex idx;
+                try {
+                    idx = parse_face_token(token);
+                } catch (const std::logic_error &) {
+                    idx = {};
+                }
+
+                int v, vn;
+                if (!resolve_obj_index(idx.v, positions.size(), v) ||
+                    (idx.vn != 0 &&
+                     !resolve_obj_index(idx.vn, normals.size(), vn))) {
+                    std::cerr << filename << ":" << line_number
+                              << ": invalid face vertex " << token << "\n";
+                    return false;
+                }
+
+                face_positions.push_back(positions[v]);
+                face_normals.push_back(idx.vn != 0 ? normals[vn]
+                                                   : glm::dvec3(0));
             }
 
-            if (face.size() < 3)
-                continue;
-
             // Fan triangulation: (0, i, i+1)
-            for (size_t i = 1; i + 1 < face.size(); ++i) {
-                const ObjIndex &i0 = face[0];
-                const ObjIndex &i1 = face[i];
-                const ObjIndex &i2 = face[i + 1];
+            for (size_t i = 1; i + 1 < face_positions.size(); ++i) {
+                emit(face_positions[0], face_positions[i],
+                     face_positions[i + 1], face_normals[0], face_normals[i],
+                     face_normals[i + 1]);
+            }
+        }
+    }
 
-                glm::dvec3 a = positions[i0.v];
-                glm::dvec3 b = positions[i1.v];
-                glm::dvec3 c = positions[i2.v];
+    return true;
+}
 
-                glm::dvec3 na = (i0.vn >= 0) ? normals[i0.vn] : glm::dvec3(0);
-                glm::dvec3 nb = (i1.vn >= 0) ? normals[i1.vn] : glm::dvec3(0);
-                glm::dvec3 nc = (i2.vn >= 0) ? normals[i2.vn] : glm::dvec3(0);
+// Throws std::runtime_error if the file cannot be read
+Mesh load_obj_triangles(const std::string &filename, const Material &material) {
+    Mesh mesh{material};
 
-                Triangle *tri = new Triangle(a, b, c, na, nb, nc, material);
+    bool loaded = read_obj_triangles(
+        filename, [&](const glm::dvec3 &a, const glm::dvec3 &b,
+                      const glm::dvec3 &c, const glm::dvec3 &na,
+                      const glm::dvec3 &nb, const glm::dvec3 &nc) {
+            Triangle *tri = new Triangle(a, b, c, na, nb, nc, material);
 
-                mesh.add(tri);
-            }
-        }
-    }
+            mesh.add(tri);
+        });
+
+    if (!loaded)
+        throw std::runtime_error("Failed to load OBJ file " + filename);
 
     return mesh;
 }
 
+// Out-of-core variant of load_obj_triangles: triangles are streamed to disk as
+// they are parsed (only the vertex lists stay in memory while loading), then
+// clustered into `cluster_path`. The mesh pages clusters back in on demand
+// within `memory_budget` bytes. Throws std::runtime_error if the file cannot be
+// read.
+StreamedMesh *load_obj_streamed(const std::string &filename,
+                                const Material &material,
+                                const glm::dvec3 &position,
+                                const std::string &cluster_path,
+                                size_t memory_budget) {
+    std::string soup_path = cluster_path + ".soup";
+    std::ofstream soup(soup_path, std::ios::binary);
+
+    bool loaded = read_obj_triangles(
+        filename, [&](const glm::dvec3 &a, const glm::dvec3 &b,
+                      const glm::dvec3 &c, const glm::dvec3 &na,
+                      const glm::dvec3 &nb, const glm::dvec3 &nc) {
+            PackedTriangle t{a + position, b + position, c + position,
+                             na, nb, nc};
+            soup.write(reinterpret_cast<const char *>(&t), sizeof(t));
+        });
+
+    soup.close();
+
+    if (!loaded) {
+        std::remove(soup_path.c_str());
+        throw std::runtime_error("Failed to load OBJ file " + filename);
+    }
+
+    return new StreamedMesh(material, soup_path, cluster_path, memory_budget);
+}
+
 #endif
\ No newline at end of file
@@ -7,17 +7,8 @@ using namespace glm;
 
 double EXPOSURE = 2;
 
-void write_ppm(const char *filename, int width, int height,
-               const std::vector<dvec3> &pixels) {
-    std::ofstream out(filename);
-    if (!out)
-        return;
-
-    // PPM header
-    out << "P3\n";
-    out << width << " " << height << "\n";
-    out << "255\n";
-
+// Exposure, ACES tonemap and gamma correction, returning 8-bit channels
+inline void tonemap(dvec3 c, int &ir, int &ig, int &ib) {
     auto aces = [](double x) {
         const double a = 2.51;
         const double b = 0.03;
@@ -29,27 +20,40 @@ void write_ppm(const char *filename, int width, int height,
 
     auto gamma_correct = [](double x) { return pow(x, 1.0 / 2.2); };
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            dvec3 c = pixels[y * width + x];
+    // exposed
+    c *= EXPOSURE;
 
-            // exposed
-            c *= EXPOSURE;
+    // ACES tonemap
+    c.r = aces(c.r);
+    c.g = aces(c.g);
+    c.b = aces(c.b);
 
-            // ACES tonemap
-            c.r = aces(c.r);
-            c.g = aces(c.g);
-            c.b = aces(c.b);
+    // // gamma correction
+    c.r = gamma_correct(c.r);
+    c.g = gamma_correct(c.g);
+    c.b = gamma_correct(c.b);
 
-            // // gamma correction
-            c.r = gamma_correct(c.r);
-            c.g = gamma_correct(c.g);
-            c.b = gamma_correct(c.b);
+    // clamp to [0, 1] and convert to [0, 255]
+    ir = static_cast<int>(255.999 * clamp(c.r, 0.0, 1.0));
+    ig = static_cast<int>(255.999 * clamp(c.g, 0.0, 1.0));
+    ib = static_cast<int>(255.999 * clamp(c.b, 0.0, 1.0));
+}
 
-            // clamp to [0, 1] and convert to [0, 255]
-            int ir = static_cast<int>(255.999 * clamp(c.r, 0.0, 1.0));
-            int ig = static_cast<int>(255.999 * clamp(c.g, 0.0, 1.0));
-            int ib = static_cast<int>(255.999 * clamp(c.b, 0.0, 1.0));
+void write_ppm(const char *filename, int width, int height,
+               const std::vector<dvec3> &pixels) {
+    std::ofstream out(filename);
+    if (!out)
+        return;
+
+    // PPM header
+    out << "P3\n";
+    out << width << " " << height << "\n";
+    out << "255\n";
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int ir, ig, ib;
+            tonemap(pixels[y * width + x], ir, ig, ib);
 
             out << ir << " " << ig << " " << ib << "\n";
         }
@@ -58,4 +62,25 @@ void write_ppm(const char *filename, int width, int height,
     std::printf("Written\n");
 }
 
-#endif
\ No newline at end of file
+// Binary (P6) PPM, for streaming frames to another process
+void write_ppm_binary(std::ostream &out, int width, int height,
+                      const std::vector<dvec3> &pixels) {
+    out << "P6\n";
+    out << width << " " << height << "\n";
+    out << "255\n";
+
+    std::vector<char> bytes(width * height * 3);
+    for (int i = 0; i < width * height; ++i) {
+        int ir, ig, ib;
+        tonemap(pixels[i], ir, ig, ib);
+
+        bytes[i * 3 + 0] = static_cast<char>(ir);
+        bytes[i * 3 + 1] = static_cast<char>(ig);
+        bytes[i * 3 + 2] = static_cast<char>(ib);
+    }
+
+    out.write(bytes.data(), bytes.size());
+    out.flush();
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "raytracer.hpp"
+
+// Every system and glm header the renderer sources use, so that including
+// them again below (inside a namespace) is a no-op. The build checks this list
+// with cmake/check_detail_includes.cmake.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+// The renderer sources define global names (Camera, Mesh, write_ppm, ...);
+// keep them out of the global namespace of programs using the library
+namespace raytracer {
+namespace detail {
+#include "camera.cpp"
+#include "obj.cpp"
+#include "shape.cpp"
+} // namespace detail
+} // namespace raytracer
+
+namespace raytracer {
+
+using namespace detail;
+
+static dvec3 to_dvec3(const Vec3 &v) { return {v.x, v.y, v.z}; }
+
+static Material to_material(const MaterialDesc &m) {
+    return {to_dvec3(m.color), to_dvec3(m.emission_color),
+            m.emission_strength, m.smoothness};
+}
+
+struct Scene::Impl {
+    HitList world;
+};
+
+Scene::Scene() : impl(std::make_unique<Impl>()) {}
+
+Scene::~Scene() = default;
+
+void Scene::add_sphere(const Vec3 &center, double radius,
+                       const MaterialDesc &material) {
+    impl->world.add(new Sphere(to_dvec3(center), to_material(material), radius));
+}
+
+void Scene::add_triangle(const Vec3 &a, const Vec3 &b, const Vec3 &c,
+                         const MaterialDesc &material) {
+    dvec3 va = to_dvec3(a);
+    dvec3 vb = to_dvec3(b);
+    dvec3 vc = to_dvec3(c);
+    dvec3 n = normalize(cross(vb - va, vc - va));
+
+    impl->world.add(new Triangle(va, vb, vc, n, n, n, to_material(material)));
+}
+
+bool Scene::add_obj(const std::string &filename, const MaterialDesc &material,
+                    const Vec3 &position) {
+    Mesh *mesh;
+    try {
+        mesh = new Mesh(load_obj_triangles(filename, to_material(material)));
+    } catch (const std::runtime_error &) {
+        // The loader has already reported the reason
+        return false;
+    }
+
+    mesh->set_position(to_dvec3(position));
+    impl->world.add(mesh);
+    return true;
+}
+
+RenderStatus render(const Scene &scene, const RenderOptions &options,
+                    float *framebuffer, const ProgressCallback &progress,
+                    const std::atomic<bool> *cancel) {
+    dvec3 direction = to_dvec3(options.camera_direction);
+
+    // The camera basis needs a direction that is neither zero nor parallel
+    // to the world up vector
+    dvec3 right = cross(dvec3(0, 1, 0), direction);
+
+    if (!framebuffer || options.width <= 0 || options.height <= 0 ||
+        options.iterations < 0 || options.bounces < 0 ||
+        !(options.fov > 0 && options.fov < 180) || dot(right, right) == 0)
+        return RenderStatus::InvalidOptions;
+
+    Camera camera{to_dvec3(options.camera_position), direction, options.fov,
+                  options.width, options.height};
+    camera.set_russian_roulette(options.russian_roulette_depth);
+
+    bool completed = camera.render_into(
+        scene.impl->world, options.bounces, options.iterations, framebuffer,
+        [&progress](int iteration, int iterations) {
+            if (progress)
+                progress(iteration, iterations);
+        },
+        cancel);
+
+    return completed ? RenderStatus::Completed : RenderStatus::Cancelled;
+}
+
+} // namespace raytracer
@@ -0,0 +1,95 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+#if defined(__GNUC__)
+#define RAYTRACER_API __attribute__((visibility("default")))
+#else
+#define RAYTRACER_API
+#endif
+
+// Public API of the raytracer_core library. Nothing in here depends on glm
+// or on the renderer's internal classes.
+namespace raytracer {
+
+struct Vec3 {
+    double x = 0;
+    double y = 0;
+    double z = 0;
+};
+
+struct MaterialDesc {
+    Vec3 color{1, 1, 1};
+    Vec3 emission_color{0, 0, 0};
+    double emission_strength = 0;
+    double smoothness = 0;
+};
+
+struct RenderOptions {
+    int width = 1920;
+    int height = 1080;
+
+    Vec3 camera_position{0, 0, 0};
+    Vec3 camera_direction{0, 0, -1};
+    // Vertical field of view in degrees, in (0, 180)
+    double fov = 90;
+
+    int bounces = 50;
+    // Bounces before Russian roulette may end a path, negative disables it
+    int russian_roulette_depth = 3;
+    int iterations = 1;
+};
+
+enum class RenderStatus { Completed, Cancelled, InvalidOptions };
+
+// Called after every iteration, from the rendering thread
+using ProgressCallback = std::function<void(int iteration, int iterations)>;
+
+class Scene;
+
+// Renders `scene` into `framebuffer`, which must hold width * height RGB
+// floats (row-major, linear radiance, not tonemapped). The buffer is written
+// in place and holds the mean of all samples so far after every iteration, so
+// it can be read from `progress`. Setting `*cancel` from another thread stops
+// the render within one image row. Concurrent calls on separate scenes and
+// framebuffers are safe.
+RAYTRACER_API RenderStatus render(const Scene &scene,
+                                  const RenderOptions &options,
+                                  float *framebuffer,
+                                  const ProgressCallback &progress = {},
+                                  const std::atomic<bool> *cancel = nullptr);
+
+class RAYTRACER_API Scene {
+  public:
+    Scene();
+    ~Scene();
+
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+
+    void add_sphere(const Vec3 &center, double radius,
+                    const MaterialDesc &material);
+
+    void add_triangle(const Vec3 &a, const Vec3 &b, const Vec3 &c,
+                      const MaterialDesc &material);
+
+    // Returns false if the file cannot be opened or parsed
+    bool add_obj(const std::string &filename, const MaterialDesc &material,
+                 const Vec3 &position = {});
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    friend RenderStatus render(const Scene &, const RenderOptions &, float *,
+                               const ProgressCallback &,
+                               const std::atomic<bool> *);
+};
+
+} // namespace raytracer
+
+#endif
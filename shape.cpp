@@ -14,7 +14,17 @@ using namespace glm;
 class Hittable {
   public:
     virtual ~Hittable() = default;
-    virtual void get_intersection(Ray ray, HitInfo &info) const = 0;
+
+    // Closest-hit query. On a hit with t_min < t < t_max, writes only t,
+    // shape, primitive and barycentrics to `info` and returns true.
+    virtual bool closest_hit(const Ray &ray, double t_min, double t_max,
+                             HitInfo &info) const = 0;
+
+    // Closest hit including point and normal
+    void get_intersection(const Ray &ray, HitInfo &info) const;
+
+    // Mixes the geometry and materials into `hash`
+    virtual void hash(uint64_t &hash) const = 0;
 };
 
 class HitList : public Hittable {
@@ -23,20 +33,24 @@ class HitList : public Hittable {
     std::vector<Hittable *> hittables;
 
   public:
-    void get_intersection(Ray ray, HitInfo &info) const {
-        constexpr double epsilon = std::numeric_limits<double>::epsilon();
-        info.t = std::numeric_limits<double>::max();
+    bool closest_hit(const Ray &ray, double t_min, double t_max,
+                     HitInfo &info) const {
+        bool did_hit = false;
 
         for (Hittable *hittable : hittables) {
-            HitInfo temp;
-            hittable->get_intersection(ray, temp);
-
-            if (temp.did_hit) {
-                if (temp.t < info.t && temp.t > epsilon) {
-                    info = temp;
-                }
+            if (hittable->closest_hit(ray, t_min, t_max, info)) {
+                did_hit = true;
+                t_max = info.t;
             }
         }
+        return did_hit;
+    }
+
+    void hash(uint64_t &hash) const {
+        hash_value(hash, hittables.size());
+        for (Hittable *hittable : hittables) {
+            hittable->hash(hash);
+        }
     }
 
     ~HitList() {
@@ -56,10 +70,21 @@ class Shape : public Hittable {
   public:
     const Material &get_material() const { return material; }
     virtual ~Shape() = default;
-    virtual void get_intersection(Ray ray, HitInfo &info) const = 0;
+
+    // Computes point and normal for a hit found by closest_hit
+    virtual void fill_attributes(const Ray &ray, HitInfo &info) const = 0;
 };
 
-class Triangle : public Shape {
+inline void Hittable::get_intersection(const Ray &ray, HitInfo &info) const {
+    constexpr double epsilon = std::numeric_limits<double>::epsilon();
+
+    info.did_hit = closest_hit(ray, epsilon,
+                               std::numeric_limits<double>::max(), info);
+    if (info.did_hit)
+        info.shape->fill_attributes(ray, info);
+}
+
+class Triangle final : public Shape {
   private:
     dvec3 a;
     dvec3 b;
@@ -86,8 +111,8 @@ class Triangle : public Shape {
     }
 
     // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-    void get_intersection(Ray ray, HitInfo &info) const {
-        info.shape = this;
+    bool closest_hit(const Ray &ray, double t_min, double t_max,
+                     HitInfo &info) const {
         constexpr double eps = std::numeric_limits<double>::epsilon();
         dvec3 ab = b - a;
         dvec3 ac = c - a;
@@ -96,39 +121,48 @@ class Triangle : public Shape {
         dvec3 dao = cross(ao, ray.get_direction());
 
         double determinant = -dot(ray.get_direction(), normal_vector);
-        if (determinant < eps) {
-            info.did_hit = false;
-            return;
-        }
+        if (determinant < eps)
+            return false;
         double invDet = 1.0 / determinant;
 
         // Calculate dst to triangle & barycentric coordinates of intersection
 
         double u = dot(ac, dao) * invDet;
-        if (u < eps || u - eps > 1.0) {
-            info.did_hit = false;
-            return;
-        }
+        if (u < eps || u - eps > 1.0)
+            return false;
 
         double v = -dot(ab, dao) * invDet;
-        if (v < eps || (v + u - eps) > 1.0) {
-            info.did_hit = false;
-            return;
-        }
+        if (v < eps || (v + u - eps) > 1.0)
+            return false;
 
         double dst = dot(ao, normal_vector) * invDet;
-        if (dst < eps) {
-            info.did_hit = false;
-            return;
-        }
+        if (dst < eps || dst <= t_min || dst >= t_max)
+            return false;
 
-        double w = 1 - u - v;
-
-        // Initialize hit info
-        info.did_hit = true;
-        info.point = ray.offset(dst);
-        info.normal = normalize(na * w + nb * u + nc * v);
+        info.shape = this;
+        info.primitive = -1;
         info.t = dst;
+        info.u = u;
+        info.v = v;
+        return true;
+    }
+
+    void fill_attributes(const Ray &ray, HitInfo &info) const {
+        double w = 1 - info.u - info.v;
+
+        info.point = ray.offset(info.t);
+        info.normal = normalize(na * w + nb * info.u + nc * info.v);
+    }
+
+    void hash(uint64_t &hash) const {
+        hash_value(hash, 'T');
+        hash_value(hash, material);
+        hash_value(hash, a);
+        hash_value(hash, b);
+        hash_value(hash, c);
+        hash_value(hash, na);
+        hash_value(hash, nb);
+        hash_value(hash, nc);
     }
 
     void shift(const dvec3 &offset) {
@@ -162,20 +196,37 @@ class Mesh : public Shape {
 
     Mesh(Material material) : Shape(material) { position = {0, 0, 0}; }
 
-    void get_intersection(Ray ray, HitInfo &info) const {
+    bool closest_hit(const Ray &ray, double t_min, double t_max,
+                     HitInfo &info) const {
         constexpr double epsilon = 1e-6;
+        t_min = std::max(t_min, epsilon);
+
+        int closest = -1;
+        for (int i = 0; i < triangles.size(); i++) {
+            if (triangles[i]->closest_hit(ray, t_min, t_max, info)) {
+                closest = i;
+                t_max = info.t;
+            }
+        }
 
-        info.t = std::numeric_limits<double>::max();
+        if (closest < 0)
+            return false;
 
-        for (Hittable *triangle : triangles) {
-            HitInfo temp;
-            triangle->get_intersection(ray, temp);
+        info.shape = this;
+        info.primitive = closest;
+        return true;
+    }
 
-            if (temp.did_hit) {
-                if (temp.t < info.t && temp.t > epsilon) {
-                    info = temp;
-                }
-            }
+    void fill_attributes(const Ray &ray, HitInfo &info) const {
+        triangles[info.primitive]->fill_attributes(ray, info);
+    }
+
+    void hash(uint64_t &hash) const {
+        hash_value(hash, 'M');
+        hash_value(hash, material);
+        hash_value(hash, triangles.size());
+        for (Triangle *triangle : triangles) {
+            triangle->hash(hash);
         }
     }
 
@@ -192,7 +243,6 @@ class Mesh : public Shape {
 
     void set_position(const dvec3 &position) {
         this->position = position;
-        std::printf("%d\n", triangles.size());
         for (int i = 0; i < triangles.size(); i++) {
             Triangle *triangle = triangles[i];
             // std::printf("%d\n", i);
@@ -231,7 +281,8 @@ class Sphere : public Shape {
     Sphere(dvec3 position, Material material, double radius)
         : Shape(material), position(position), radius(radius) {}
 
-    void get_intersection(Ray ray, HitInfo &info) const override {
+    bool closest_hit(const Ray &ray, double t_min, double t_max,
+                     HitInfo &info) const override {
         dvec3 op = position - ray.get_origin();
         dvec3 rd = ray.get_direction();
         double a = dot(rd, rd);
@@ -239,10 +290,8 @@ class Sphere : public Shape {
         double c = dot(op, op) - radius * radius;
 
         double discriminant = h * h - a * c;
-        if (discriminant < 0) {
-            info.did_hit = false;
-            return;
-        }
+        if (discriminant < 0)
+            return false;
 
         double x;
         if (discriminant == 0)
@@ -250,15 +299,25 @@ class Sphere : public Shape {
         else
             x = (h - sqrt(discriminant)) / a;
 
-        if (x <= 1e-10)
-            info.did_hit = false;
-        else {
-            info.did_hit = true;
-            info.shape = this;
-            info.t = x;
-            info.point = ray.offset(x);
-            info.normal = (info.point - get_position()) / radius;
-        }
+        if (x <= 1e-10 || x <= t_min || x >= t_max)
+            return false;
+
+        info.shape = this;
+        info.primitive = -1;
+        info.t = x;
+        return true;
+    }
+
+    void fill_attributes(const Ray &ray, HitInfo &info) const override {
+        info.point = ray.offset(info.t);
+        info.normal = (info.point - get_position()) / radius;
+    }
+
+    void hash(uint64_t &hash) const override {
+        hash_value(hash, 'S');
+        hash_value(hash, material);
+        hash_value(hash, position);
+        hash_value(hash, radius);
     }
 
     const dvec3 &get_position() const { return position; }
@@ -0,0 +1,457 @@
+#ifndef STREAMED_MESH_H
+#define STREAMED_MESH_H
+
+#include "common.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "shape.cpp"
+
+using namespace glm;
+
+// On-disk triangle record
+struct PackedTriangle {
+    dvec3 a;
+    dvec3 b;
+    dvec3 c;
+    dvec3 na;
+    dvec3 nb;
+    dvec3 nc;
+};
+
+struct Bounds {
+    dvec3 min{std::numeric_limits<double>::max()};
+    dvec3 max{-std::numeric_limits<double>::max()};
+
+    void grow(const dvec3 &p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    // Slab test, `t_near` is the distance at which the ray enters the box
+    bool intersect(const Ray &ray, double max_t, double &t_near) const {
+        double t0 = 0;
+        double t1 = max_t;
+        for (int a = 0; a < 3; a++) {
+            double inv_d = 1.0 / ray.get_direction()[a];
+            double t_min = (min[a] - ray.get_origin()[a]) * inv_d;
+            double t_max = (max[a] - ray.get_origin()[a]) * inv_d;
+            if (inv_d < 0)
+                std::swap(t_min, t_max);
+
+            t0 = std::max(t0, t_min);
+            t1 = std::min(t1, t_max);
+            if (t1 < t0)
+                return false;
+        }
+        t_near = t0;
+        return true;
+    }
+};
+
+struct StreamingStats {
+    size_t page_faults = 0;
+    size_t cache_hits = 0;
+    size_t evictions = 0;
+    size_t bytes_read = 0;
+    size_t resident_bytes = 0;
+    size_t peak_resident_bytes = 0;
+};
+
+// Mesh whose triangles live on disk, grouped into spatially coherent
+// clusters. Only the cluster bounds stay resident; the triangles of a cluster
+// are paged in when a ray reaches its bounds and evicted least recently used
+// first to stay within the memory budget.
+class StreamedMesh : public Shape {
+
+  private:
+    struct Cluster {
+        Bounds bounds;
+        size_t offset = 0;
+        int count = 0;
+
+        bool resident = false;
+        std::vector<Triangle> triangles;
+        std::list<int>::iterator lru_position;
+    };
+
+    size_t memory_budget;
+    std::string cluster_path;
+
+    // Binary hierarchy over the cluster bounds, so a ray only tests the
+    // clusters along its path. Leaves hold `count` entries of `node_clusters`
+    // starting at `first`, inner nodes have count 0.
+    struct Node {
+        Bounds bounds;
+        int left = -1;
+        int right = -1;
+        int first = 0;
+        int count = 0;
+    };
+
+    static constexpr int LEAF_SIZE = 2;
+
+    // Triangles buffered while writing the cluster file
+    static constexpr size_t SCATTER_BUFFER_BYTES = 64 << 20;
+
+    // Enough for a median-split hierarchy over any cluster count
+    static constexpr int MAX_DEPTH = 64;
+
+    std::vector<Node> nodes;
+    std::vector<int> node_clusters;
+
+    mutable std::vector<Cluster> clusters;
+    mutable std::list<int> lru;
+    mutable std::ifstream cluster_file;
+    mutable StreamingStats stats;
+
+    static int cell_of(const dvec3 &p, const Bounds &bounds, int res) {
+        dvec3 extent = bounds.max - bounds.min;
+        int idx[3];
+        for (int a = 0; a < 3; a++) {
+            double f =
+                extent[a] > 0 ? (p[a] - bounds.min[a]) / extent[a] : 0.0;
+            idx[a] = std::clamp((int)(f * res), 0, res - 1);
+        }
+        return (idx[2] * res + idx[1]) * res + idx[0];
+    }
+
+    static dvec3 centroid(const PackedTriangle &t) {
+        return (t.a + t.b + t.c) / 3.0;
+    }
+
+    int build_node(int first, int count) {
+        Node node;
+        Bounds centers;
+        for (int i = first; i < first + count; i++) {
+            const Bounds &b = clusters[node_clusters[i]].bounds;
+            node.bounds.grow(b.min);
+            node.bounds.grow(b.max);
+            centers.grow((b.min + b.max) * 0.5);
+        }
+
+        int index = nodes.size();
+        if (count <= LEAF_SIZE) {
+            node.first = first;
+            node.count = count;
+            nodes.push_back(node);
+            return index;
+        }
+
+        // Median split along the widest axis of the cluster centers
+        dvec3 extent = centers.max - centers.min;
+        int axis = 0;
+        if (extent.y > extent[axis])
+            axis = 1;
+        if (extent.z > extent[axis])
+            axis = 2;
+
+        int mid = count / 2;
+        auto begin = node_clusters.begin() + first;
+        std::nth_element(begin, begin + mid, begin + count,
+                         [this, axis](int a, int b) {
+                             const Bounds &ba = clusters[a].bounds;
+                             const Bounds &bb = clusters[b].bounds;
+                             return ba.min[axis] + ba.max[axis] <
+                                    bb.min[axis] + bb.max[axis];
+                         });
+
+        nodes.push_back(node);
+        int left = build_node(first, mid);
+        int right = build_node(first + mid, count - mid);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+
+    void evict(int index) const {
+        Cluster &cluster = clusters[index];
+
+        std::vector<Triangle>().swap(cluster.triangles);
+        cluster.resident = false;
+        lru.erase(cluster.lru_position);
+
+        stats.resident_bytes -= cluster.count * sizeof(Triangle);
+        stats.evictions++;
+    }
+
+    const std::vector<Triangle> &fetch(int index) const {
+        Cluster &cluster = clusters[index];
+
+        if (cluster.resident) {
+            stats.cache_hits++;
+            lru.splice(lru.begin(), lru, cluster.lru_position);
+            return cluster.triangles;
+        }
+
+        stats.page_faults++;
+
+        size_t bytes = cluster.count * sizeof(Triangle);
+        while (!lru.empty() && stats.resident_bytes + bytes > memory_budget)
+            evict(lru.back());
+
+        std::vector<PackedTriangle> packed(cluster.count);
+        cluster_file.clear();
+        cluster_file.seekg(cluster.offset * sizeof(PackedTriangle));
+        cluster_file.read(reinterpret_cast<char *>(packed.data()),
+                          packed.size() * sizeof(PackedTriangle));
+        if (!cluster_file)
+            throw std::runtime_error("Short read from cluster file " +
+                                     cluster_path);
+
+        cluster.triangles.reserve(cluster.count);
+        for (const PackedTriangle &t : packed) {
+            cluster.triangles.emplace_back(t.a, t.b, t.c, t.na, t.nb, t.nc,
+                                           material);
+        }
+
+        cluster.resident = true;
+        lru.push_front(index);
+        cluster.lru_position = lru.begin();
+
+        stats.bytes_read += packed.size() * sizeof(PackedTriangle);
+        stats.resident_bytes += bytes;
+        stats.peak_resident_bytes =
+            std::max(stats.peak_resident_bytes, stats.resident_bytes);
+
+        return cluster.triangles;
+    }
+
+  public:
+    // Partitions the triangles in `soup_path` (a flat file of PackedTriangle)
+    // into clusters of roughly `cluster_size` triangles, written to
+    // `cluster_path`. The soup is streamed through twice and then removed, so
+    // the triangles are never all in memory at once.
+    StreamedMesh(Material material, const std::string &soup_path,
+                 const std::string &cluster_path, size_t memory_budget,
+                 int cluster_size = 256)
+        : Shape(material), memory_budget(memory_budget),
+          cluster_path(cluster_path) {
+        PackedTriangle t;
+
+        // Centroid bounds
+        std::ifstream soup(soup_path, std::ios::binary);
+        Bounds centroid_bounds;
+        size_t n = 0;
+        while (soup.read(reinterpret_cast<char *>(&t), sizeof(t))) {
+            centroid_bounds.grow(centroid(t));
+            n++;
+        }
+
+        // Uniform grid over the centroids, about cluster_size triangles per
+        // cell
+        int res = std::max(
+            1, (int)std::ceil(std::cbrt((double)n / (double)cluster_size)));
+        std::vector<int> cell_counts(res * res * res);
+        std::vector<Bounds> cell_bounds(res * res * res);
+
+        soup.clear();
+        soup.seekg(0);
+        while (soup.read(reinterpret_cast<char *>(&t), sizeof(t))) {
+            int cell = cell_of(centroid(t), centroid_bounds, res);
+            cell_counts[cell]++;
+            cell_bounds[cell].grow(t.a);
+            cell_bounds[cell].grow(t.b);
+            cell_bounds[cell].grow(t.c);
+        }
+
+        // Non-empty cells become clusters, stored back to back
+        std::vector<int> cell_cluster(res * res * res, -1);
+        size_t offset = 0;
+        for (int cell = 0; cell < res * res * res; cell++) {
+            if (cell_counts[cell] == 0)
+                continue;
+
+            Cluster cluster;
+            cluster.bounds = cell_bounds[cell];
+            cluster.offset = offset;
+            cluster.count = cell_counts[cell];
+
+            cell_cluster[cell] = clusters.size();
+            clusters.push_back(std::move(cluster));
+            offset += cell_counts[cell];
+        }
+
+        // Scatter the triangles into their clusters. They are buffered per
+        // cluster, up to SCATTER_BUFFER_BYTES in total, and each flush writes
+        // every buffered cluster as one contiguous block.
+        std::vector<size_t> written(clusters.size());
+        std::vector<std::vector<PackedTriangle>> pending(clusters.size());
+        std::vector<int> dirty;
+        size_t buffered = 0;
+
+        std::ofstream out(cluster_path, std::ios::binary);
+        if (!out)
+            throw std::runtime_error("Cannot create cluster file " +
+                                     cluster_path);
+
+        auto flush = [&]() {
+            for (int index : dirty) {
+                std::vector<PackedTriangle> &batch = pending[index];
+                size_t slot = clusters[index].offset + written[index];
+                out.seekp(slot * sizeof(PackedTriangle));
+                out.write(reinterpret_cast<const char *>(batch.data()),
+                          batch.size() * sizeof(PackedTriangle));
+
+                written[index] += batch.size();
+                std::vector<PackedTriangle>().swap(batch);
+            }
+            dirty.clear();
+            buffered = 0;
+        };
+
+        soup.clear();
+        soup.seekg(0);
+        while (soup.read(reinterpret_cast<char *>(&t), sizeof(t))) {
+            int index = cell_cluster[cell_of(centroid(t), centroid_bounds, res)];
+            if (pending[index].empty())
+                dirty.push_back(index);
+            pending[index].push_back(t);
+
+            buffered += sizeof(PackedTriangle);
+            if (buffered >= SCATTER_BUFFER_BYTES)
+                flush();
+        }
+        flush();
+
+        out.close();
+        if (!out)
+            throw std::runtime_error("Failed to write cluster file " +
+                                     cluster_path);
+        soup.close();
+        std::remove(soup_path.c_str());
+
+        cluster_file.open(cluster_path, std::ios::binary);
+
+        for (int i = 0; i < clusters.size(); i++) {
+            node_clusters.push_back(i);
+        }
+        if (!clusters.empty())
+            build_node(0, clusters.size());
+    }
+
+    ~StreamedMesh() {
+        cluster_file.close();
+        std::remove(cluster_path.c_str());
+    }
+
+    bool closest_hit(const Ray &ray, double t_min, double t_max,
+                     HitInfo &info) const override {
+        constexpr double epsilon = 1e-6;
+        t_min = std::max(t_min, epsilon);
+
+        if (nodes.empty())
+            return false;
+
+        // Visit the hierarchy front to back, so clusters behind the closest
+        // hit are neither tested nor paged in
+        int stack[MAX_DEPTH];
+        int size = 0;
+        stack[size++] = 0;
+
+        int closest = -1;
+        while (size > 0) {
+            const Node &node = nodes[stack[--size]];
+
+            double t_near;
+            if (!node.bounds.intersect(ray, t_max, t_near))
+                continue;
+
+            if (node.count == 0) {
+                double t_left, t_right;
+                bool left = nodes[node.left].bounds.intersect(ray, t_max,
+                                                              t_left);
+                bool right = nodes[node.right].bounds.intersect(ray, t_max,
+                                                                t_right);
+
+                // Push the far child first so the near one is visited first
+                if (left && right && t_left <= t_right) {
+                    stack[size++] = node.right;
+                    stack[size++] = node.left;
+                } else if (left && right) {
+                    stack[size++] = node.left;
+                    stack[size++] = node.right;
+                } else if (left) {
+                    stack[size++] = node.left;
+                } else if (right) {
+                    stack[size++] = node.right;
+                }
+                continue;
+            }
+
+            for (int n = node.first; n < node.first + node.count; n++) {
+                int index = node_clusters[n];
+                if (!clusters[index].bounds.intersect(ray, t_max, t_near))
+                    continue;
+
+                const std::vector<Triangle> &triangles = fetch(index);
+                for (int i = 0; i < triangles.size(); i++) {
+                    if (triangles[i].closest_hit(ray, t_min, t_max, info)) {
+                        closest = clusters[index].offset + i;
+                        t_max = info.t;
+                    }
+                }
+            }
+        }
+
+        if (closest < 0)
+            return false;
+
+        // The winning triangle may be evicted later, so report the mesh
+        // itself with the triangle's index in the cluster file
+        info.shape = this;
+        info.primitive = closest;
+        return true;
+    }
+
+    void fill_attributes(const Ray &ray, HitInfo &info) const override {
+        // Clusters are stored in offset order
+        auto it = std::upper_bound(
+            clusters.begin(), clusters.end(), (size_t)info.primitive,
+            [](size_t primitive, const Cluster &cluster) {
+                return primitive < cluster.offset;
+            });
+        int index = (it - clusters.begin()) - 1;
+
+        const std::vector<Triangle> &triangles = fetch(index);
+        triangles[info.primitive - clusters[index].offset].fill_attributes(
+            ray, info);
+    }
+
+    // Hashes the cluster file through its own stream, so the cache and the
+    // stats are left alone
+    void hash(uint64_t &hash) const override {
+        hash_value(hash, 'C');
+        hash_value(hash, material);
+        hash_value(hash, clusters.size());
+
+        std::ifstream in(cluster_path, std::ios::binary);
+        std::vector<char> buffer(1 << 20);
+        while (in) {
+            in.read(buffer.data(), buffer.size());
+            hash_bytes(hash, buffer.data(), in.gcount());
+        }
+    }
+
+    const StreamingStats &get_stats() const { return stats; }
+
+    // Written to stderr, stdout may carry the interactive frame stream
+    void print_stats() const {
+        std::fprintf(stderr, "Clusters: %zu, resident: %zu\n",
+                     clusters.size(), lru.size());
+        std::fprintf(stderr,
+                     "Page faults: %zu, cache hits: %zu, evictions: %zu\n",
+                     stats.page_faults, stats.cache_hits, stats.evictions);
+        std::fprintf(stderr,
+                     "Resident bytes: %zu (peak %zu, budget %zu), read %zu\n",
+                     stats.resident_bytes, stats.peak_resident_bytes,
+                     memory_budget, stats.bytes_read);
+    }
+};
+
+#endif
@@ -0,0 +1,208 @@
+// Exercises the public raytracer_core API: option validation, OBJ loading
+// errors, progress reporting, cancellation and concurrent renders.
+
+#include "raytracer.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace raytracer;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,       \
+                         __LINE__, #condition);                                \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static RenderOptions small_options() {
+    RenderOptions options;
+    options.width = 64;
+    options.height = 36;
+    options.camera_position = {0, 0, 3};
+    options.bounces = 5;
+    options.iterations = 3;
+    return options;
+}
+
+static void build_scene(Scene &scene, const Vec3 &color) {
+    MaterialDesc light;
+    light.color = {0, 0, 0};
+    light.emission_color = {1, 1, 1};
+    light.emission_strength = 2;
+    scene.add_sphere({0, 2, 0}, 1, light);
+
+    MaterialDesc diffuse;
+    diffuse.color = color;
+    scene.add_sphere({0, 0, 0}, 1, diffuse);
+    scene.add_triangle({-5, -1, -5}, {-5, -1, 5}, {5, -1, 5}, diffuse);
+}
+
+static std::string write_file(const std::string &name,
+                              const std::string &contents) {
+    std::string path =
+        (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream(path) << contents;
+    return path;
+}
+
+static void test_invalid_options() {
+    Scene scene;
+    build_scene(scene, {1, 1, 1});
+
+    RenderOptions options = small_options();
+    std::vector<float> frame(options.width * options.height * 3);
+    CHECK(render(scene, options, nullptr) == RenderStatus::InvalidOptions);
+
+    auto rejected = [&](void (*change)(RenderOptions &)) {
+        RenderOptions bad = small_options();
+        change(bad);
+        return render(scene, bad, frame.data()) ==
+               RenderStatus::InvalidOptions;
+    };
+    CHECK(rejected([](RenderOptions &o) { o.width = 0; }));
+    CHECK(rejected([](RenderOptions &o) { o.height = -1; }));
+    CHECK(rejected([](RenderOptions &o) { o.iterations = -1; }));
+    CHECK(rejected([](RenderOptions &o) { o.bounces = -1; }));
+    CHECK(rejected([](RenderOptions &o) { o.fov = 0; }));
+    CHECK(rejected([](RenderOptions &o) { o.fov = 180; }));
+    CHECK(rejected([](RenderOptions &o) { o.camera_direction = {0, 0, 0}; }));
+    CHECK(rejected([](RenderOptions &o) { o.camera_direction = {0, 1, 0}; }));
+
+    CHECK(render(scene, options, frame.data()) == RenderStatus::Completed);
+}
+
+static void test_obj_files() {
+    MaterialDesc material;
+
+    // Relative (negative) indices are valid
+    Scene good;
+    std::string good_path =
+        write_file("raytracer_core_test_good.obj",
+                   "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\n"
+                   "f 1//1 2//1 3//1\nf -3 -2 -1\n");
+    CHECK(good.add_obj(good_path, material));
+    std::filesystem::remove(good_path);
+
+    const char *bad_files[] = {
+        "v 0 0 0\nv 1 0 0\nf 1 2 999999\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -4\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 0\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 x 3\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 99999999999\n",
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//2\n",
+    };
+    for (const char *contents : bad_files) {
+        Scene scene;
+        std::string path = write_file("raytracer_core_test_bad.obj", contents);
+        CHECK(!scene.add_obj(path, material));
+        std::filesystem::remove(path);
+    }
+
+    Scene missing;
+    CHECK(!missing.add_obj("raytracer_core_test_missing.obj", material));
+}
+
+static void test_progress() {
+    Scene scene;
+    build_scene(scene, {1, 1, 1});
+
+    RenderOptions options = small_options();
+    options.iterations = 5;
+    std::vector<float> frame(options.width * options.height * 3);
+
+    std::vector<int> reported;
+    RenderStatus status = render(scene, options, frame.data(),
+                                 [&](int iteration, int iterations) {
+                                     CHECK(iterations == options.iterations);
+                                     reported.push_back(iteration);
+                                 });
+
+    CHECK(status == RenderStatus::Completed);
+    CHECK(reported.size() == (size_t)options.iterations);
+    for (size_t i = 0; i < reported.size(); i++) {
+        CHECK(reported[i] == (int)i + 1);
+    }
+}
+
+static void test_cancel() {
+    Scene scene;
+    build_scene(scene, {1, 1, 1});
+
+    RenderOptions options = small_options();
+    options.iterations = 100;
+    std::vector<float> frame(options.width * options.height * 3);
+
+    // Cancelled from the progress callback, the next iteration stops at its
+    // first row
+    std::atomic<bool> cancel{false};
+    int calls = 0;
+    RenderStatus status = render(
+        scene, options, frame.data(),
+        [&](int iteration, int) {
+            calls++;
+            if (iteration == 2)
+                cancel = true;
+        },
+        &cancel);
+    CHECK(status == RenderStatus::Cancelled);
+    CHECK(calls == 2);
+
+    calls = 0;
+    status = render(
+        scene, options, frame.data(), [&](int, int) { calls++; }, &cancel);
+    CHECK(status == RenderStatus::Cancelled);
+    CHECK(calls == 0);
+}
+
+static void test_concurrent_renders() {
+    Scene a;
+    Scene b;
+    build_scene(a, {0.8, 0.2, 0.2});
+    build_scene(b, {0.2, 0.2, 0.8});
+
+    RenderOptions options = small_options();
+    size_t size = options.width * options.height * 3;
+    std::vector<float> sequential_a(size), sequential_b(size);
+    CHECK(render(a, options, sequential_a.data()) == RenderStatus::Completed);
+    CHECK(render(b, options, sequential_b.data()) == RenderStatus::Completed);
+    CHECK(sequential_a != sequential_b);
+
+    std::vector<float> concurrent_a(size), concurrent_b(size);
+    RenderStatus status_a, status_b;
+    std::thread thread_a(
+        [&] { status_a = render(a, options, concurrent_a.data()); });
+    std::thread thread_b(
+        [&] { status_b = render(b, options, concurrent_b.data()); });
+    thread_a.join();
+    thread_b.join();
+
+    CHECK(status_a == RenderStatus::Completed);
+    CHECK(status_b == RenderStatus::Completed);
+    CHECK(concurrent_a == sequential_a);
+    CHECK(concurrent_b == sequential_b);
+}
+
+int main() {
+    test_invalid_options();
+    test_obj_files();
+    test_progress();
+    test_cancel();
+    test_concurrent_renders();
+
+    if (failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,95 @@
+// Traces rays against a generated scene several times larger than the
+// memory budget, through StreamedMesh and through a fully resident Mesh, and
+// checks that the hits agree while the budget is respected.
+
+#include "common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "streamed_mesh.cpp"
+
+using namespace glm;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,       \
+                         __LINE__, #condition);                                \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+int main() {
+    const int triangle_count = 20000;
+    const int ray_count = 2000;
+
+    Material material{{1, 1, 1}, {0, 0, 0}, 0, 0};
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string soup_path = dir + "/streamed_mesh_test.soup";
+    std::string cluster_path = dir + "/streamed_mesh_test.clusters";
+
+    // Small random triangles scattered through a box, all facing +z so rays
+    // going -z can hit them
+    seed_random(12345);
+    Mesh mesh{material};
+    {
+        std::ofstream soup(soup_path, std::ios::binary);
+        for (int i = 0; i < triangle_count; i++) {
+            dvec3 center{random_double(-10, 10), random_double(-10, 10),
+                         random_double(-10, 10)};
+            dvec3 a = center + dvec3{-0.3, -0.3, 0};
+            dvec3 b = center + dvec3{0.3, -0.3, 0};
+            dvec3 c = center + dvec3{0, 0.3, 0};
+            dvec3 n{0, 0, 1};
+
+            PackedTriangle t{a, b, c, n, n, n};
+            soup.write(reinterpret_cast<const char *>(&t), sizeof(t));
+
+            mesh.add(new Triangle(a, b, c, n, n, n, material));
+        }
+    }
+
+    size_t resident_size = triangle_count * sizeof(Triangle);
+    size_t budget = resident_size / 8;
+
+    StreamedMesh streamed{material, soup_path, cluster_path, budget};
+
+    int hits = 0;
+    for (int i = 0; i < ray_count; i++) {
+        Ray ray{{random_double(-10, 10), random_double(-10, 10), 20},
+                {random_double(-0.2, 0.2), random_double(-0.2, 0.2), -1}};
+
+        HitInfo expected;
+        HitInfo actual;
+        mesh.get_intersection(ray, expected);
+        streamed.get_intersection(ray, actual);
+
+        CHECK(expected.did_hit == actual.did_hit);
+        if (expected.did_hit && actual.did_hit) {
+            hits++;
+            CHECK(expected.t == actual.t);
+            CHECK(expected.point.x == actual.point.x &&
+                  expected.point.y == actual.point.y &&
+                  expected.point.z == actual.point.z);
+        }
+    }
+
+    const StreamingStats &stats = streamed.get_stats();
+    streamed.print_stats();
+
+    CHECK(hits > 0);
+    CHECK(stats.peak_resident_bytes <= budget);
+    CHECK(stats.page_faults > 0);
+    CHECK(stats.evictions > 0);
+
+    if (failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("%d / %d rays hit, all match\n", hits, ray_count);
+    return EXIT_SUCCESS;
+}